@@ -1,7 +1,18 @@
 #ifndef BUF_H
 #define BUF_H
 
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <thread>
+#include <condition_variable>
+#include <iostream>
 #include "db.h"
+#include "bufPolicy.h"
+#include "bufTier.h"
 // define if debug output wanted
 //#define DEBUGBUF
 
@@ -15,17 +26,29 @@ struct hashBucket
 };
 
 
-// hash table to keep track of pages in the buffer pool
+// hash table to keep track of pages in the buffer pool.  The table
+// is split into independently latched partitions; callers must hold
+// latch(file,pageNo) around insert, lookup and remove.
 class BufHashTbl
 {
 private:
-    int HTSIZE;
-    hashBucket**  ht; // actual hash table
-    int	 hash(const File* file, const int pageNo); // returns value between 0 and HTSIZE-1
+    struct alignas(64) Partition {   // one cache line per latch
+        std::mutex   latch;  // protects ht
+        hashBucket** ht;     // buckets of this partition
+    };
+
+    int HTSIZE;       // buckets per partition
+    int numParts;     // number of partitions
+    Partition* parts; // actual hash table
+    unsigned int hash(const File* file, const int pageNo);
+    Partition& partition(const File* file, const int pageNo, int& index);
 
 public:
-    BufHashTbl(const int htSize);  // constructor
+    BufHashTbl(const int htSize, const int partitions = 1);  // constructor
     ~BufHashTbl(); // destructor
+
+    // latch of the partition that (file,pageNo) maps to
+  std::mutex& latch(const File* file, const int pageNo);
 	
     // insert entry into hash table mapping (file,pageNo) to frameNo;
     // returns 0 if OK, HASHTBLERROR if an error occurred
@@ -42,19 +65,78 @@ public:
 };
 
 
+// Open addressing replacement for BufHashTbl with the same contract.
+// Entries live in flat, preallocated per-partition arrays probed
+// linearly, so insert and remove never touch the heap and a lookup
+// usually reads a single cache line.  Partition and slot are taken
+// from different bits of a 64-bit mix of (file,pageNo), so growing
+// a partition's array never moves entries to another partition.
+class BufOAHashTbl
+{
+private:
+    struct hashEntry {
+        const File* file;   // NULL if the slot is empty
+        int pageNo;
+        int frameNo;
+    };
+
+    struct alignas(64) Partition {   // one cache line per latch
+        std::mutex latch;   // protects slots, nslots and count
+        hashEntry* slots;   // nslots entries
+        int nslots;         // a power of two
+        int count;          // entries in use
+    };
+
+    int numParts;       // number of partitions
+    double maxLoad;
+    Partition* parts;
+    static unsigned long long hash(const File* file, const int pageNo);
+    Partition& partition(const File* file, const int pageNo, unsigned int& index);
+    int slotsFor(int capacity) const;
+    void rehash(Partition& part, const int nslots);
+
+public:
+    // capacity is the most entries the table must hold (the number of
+    // buffer frames); maxLoad the load factor it is sized for
+    BufOAHashTbl(const int capacity, const int partitions = 1,
+                 const double maxLoad = 0.75);
+    ~BufOAHashTbl();
+
+    int slotsPerPartition();
+
+    // make room for capacity entries.  Partitions are grown one at a
+    // time, each under its own latch, so lookups elsewhere go on;
+    // tables never shrink.
+  void reserve(const int capacity);
+
+    // latch of the partition that (file,pageNo) maps to
+  std::mutex& latch(const File* file, const int pageNo);
+
+    // same as in BufHashTbl; insert returns HASHTBLERROR if the
+    // entry exists already or the partition is full
+  Status insert(const File* file, const int pageNo, const int frameNo);
+  Status lookup(const File* file, const int pageNo, int & frameNo);
+  Status remove(const File* file, const int pageNo);
+};
+
+
 class BufMgr;  //forward declaration of BufMgr class 
 
-// class for maintaining information about buffer pool frames
+// class for maintaining information about buffer pool frames.
+// file, pageNo and valid only change while latch is held; pinCnt is
+// only incremented under the hash table latch of (file,pageNo).
 class BufDesc {
     friend class BufMgr;
 private:
   File* file;   // pointer to file object
   int   pageNo; // page within file
   int	frameNo;  // frame # of frame
-  int   pinCnt; // number of times this page has been pinned
-  bool 	dirty;	  // true if dirty;  false otherwise
-  bool 	valid;   // true if page is valid
-  bool  refbit;	 // has this buffer frame been reference recently
+  std::atomic<int>  pinCnt; // number of times this page has been pinned
+  std::atomic<bool> dirty;  // true if dirty;  false otherwise
+  std::atomic<bool> valid;  // true if page is valid
+  std::atomic<bool> loading; // true while page is being read from disk
+  std::atomic<bool> prefetched; // read ahead and not accessed since
+  std::mutex latch;  // held while the frame is filled, written or evicted
 
   void Clear() {  // initialize buffer frame for a new user
     	pinCnt = 0;
@@ -62,6 +144,7 @@ private:
 	pageNo = -1;
     	dirty = false;
 	valid = false;
+	prefetched = false;
   };
 
   void Set(File* filePtr, int pageNum) { 
@@ -70,25 +153,95 @@ private:
       pinCnt = 1;
       dirty = false;
       valid = true;
-      refbit = true;
+      prefetched = false;
   }
 
   BufDesc() {
       Clear();
+      loading = false;
+  }
+};
+
+
+// A pinned page, as handed out by BufMgr::readPage, allocPage and
+// pinPages.  The pin is dropped when the guard goes out of scope or
+// release() is called; the guard carries the frame number, so this
+// needs no hash table lookup.  Guards can be moved but not copied,
+// so exactly one guard owns each pin and passing a page on costs no
+// pin traffic.  Disposing of a page while a guard holds it is an
+// error, as is letting a guard outlive its buffer manager.
+class PageGuard {
+    friend class BufMgr;
+private:
+  BufMgr* mgr;      // NULL if the guard holds no pin
+  File*   file;
+  int     pageNo;
+  int     frameNo;
+  Page*   page;
+  bool    dirty;    // unpin the page dirty
+
+  void set(BufMgr* m, File* f, int p, int frame, Page* pg)
+  {
+      mgr = m;
+      file = f;
+      pageNo = p;
+      frameNo = frame;
+      page = pg;
+      dirty = false;
   }
+
+public:
+  PageGuard() : mgr(NULL), file(NULL), pageNo(-1), frameNo(-1),
+                page(NULL), dirty(false) {}
+  PageGuard(PageGuard&& other);
+  PageGuard& operator = (PageGuard&& other);
+  PageGuard(const PageGuard&) = delete;
+  PageGuard& operator = (const PageGuard&) = delete;
+  ~PageGuard() { (void)release(); }
+
+  bool   pinned() const { return mgr != NULL; }
+  Page*  get() const { return page; }
+  Page*  operator -> () const { return page; }
+  template <class P> P* as() const { return (P*)page; } // pages of other sizes
+  File*  getFile() const { return file; }
+  int    getPageNo() const { return pageNo; }
+  void   setDirty() { dirty = true; }   // the page has been changed
+
+  const Status release();  // unpin now; OK if nothing was pinned
 };
 
 
+// Buffer pool statistics, as returned by BufMgr::getBufStats: a copy
+// of the counters at that moment.  Subtracting two copies gives what
+// happened in between.
 struct BufStats
 {
-  int accesses;    // Total number of accesses to buffer pool
-  int diskreads;   // Number of pages read from disk (including allocs)
-  int diskwrites;  // Number of pages written back to disk
+  unsigned long long accesses;    // Total number of accesses to buffer pool
+  unsigned long long hits;        // ... that found the page in the pool
+  unsigned long long misses;      // ... that had to read it from disk
+  unsigned long long allocs;      // ... that were allocPage calls
+  unsigned long long diskreads;   // Number of pages read from disk (including allocs)
+  unsigned long long diskwrites;  // Number of pages written back to disk
+  unsigned long long fgwrites;    // ... by allocBuf and flushFile in the caller's thread
+  unsigned long long bgwrites;    // ... by the background writer
+  unsigned long long prefetchIssued; // pages read ahead (included in diskreads)
+  unsigned long long prefetchHits;   // ... that were accessed afterwards
+  unsigned long long prefetchWasted; // ... that left the pool unaccessed
+  unsigned long long evictions;      // pages replaced to make room
+  unsigned long long dirtyEvictions; // ... that had to be written back first
+  unsigned long long allocBufCalls;  // frames asked for
+  unsigned long long sweepSteps;     // frames the policy looked at to find them
+  unsigned long long bufferExceeded; // requests failed with BUFFEREXCEEDED
+  unsigned long long preloaded;      // pages read from a manifest (in prefetchIssued)
+  unsigned long long tierHits;       // misses served by the compressed tier (not in diskreads)
+  unsigned long long tierStores;     // evicted pages it took in
+  unsigned long long tierRejects;    // ... it turned away as not compressing well
+  unsigned long long tierDrops;      // pages it let go of to stay within budget
 
-  void clear()
-    {
-      accesses = diskreads = diskwrites = 0;
-    }
+  void clear();
+  double hitRatio() const;        // hits / (hits + misses)
+  BufStats operator - (const BufStats & before) const;
+  void print(std::ostream & os) const;
       
   BufStats()
     {
@@ -97,44 +250,361 @@ struct BufStats
 };
 
 
-class BufMgr 
+// tunables for a buffer manager, fixed at construction
+struct BufConfig
+{
+  int partitions;  // number of independently latched hash table partitions
+  ReplPolicy policy;  // page replacement policy
+
+  // background writer: when more than dirtyHigh of the frames are
+  // dirty it writes unpinned dirty pages until at most dirtyLow are;
+  // every writerInterval ms it also cleans the next writerLookahead
+  // frames the replacement policy would evict
+  bool bgWriter;
+  double dirtyHigh;
+  double dirtyLow;
+  int writerInterval;
+  int writerLookahead;
+
+  // fdatasync each file written by flushFile, flushAll or the destructor
+  bool syncOnFlush;
+
+  // read-ahead: once readAheadTrigger pages of a file have been read
+  // in sequence, the next readAhead pages are read into free or clean
+  // frames with one vectored read, and the window is kept ahead of
+  // the reader.  readAhead 0 turns it off.
+  int readAhead;
+  int readAheadTrigger;
+
+  // hugePages: allocate the pool as one mapping aligned to 2MB and
+  // backed by huge pages, from the reserved pool (MAP_HUGETLB) if
+  // there is one, else transparent huge pages.  directIO: map the
+  // pool too, so that frames meet O_DIRECT's alignment rules and
+  // files opened with DB::openFile's directIO flag are read into and
+  // written from them without a bounce buffer.  Such files have pages
+  // cached once, in the pool, rather than in the kernel's page cache
+  // as well.
+  bool hugePages;
+  bool directIO;
+
+  // size of the frames in bytes, one of the sizes validPageSize
+  // accepts (others give PAGESIZE).  Only files created with this
+  // page size can be read through the pool; pools of several sizes
+  // may be used side by side.
+  int pageSize;
+
+  // warm restart: if manifest names a file, the pages resident in
+  // the pool are listed there every manifestInterval ms (0: only by
+  // saveManifest and when the buffer manager goes away), and the
+  // pages listed there at construction are read back into the pool
+  // in the background as their files are opened, or at once for files
+  // already open.  See saveManifest.
+  std::string manifest;
+  int manifestInterval;
+
+  // the most frames BufMgr::resize may grow the pool to; 0 for 64
+  // times the initial size
+  int maxBufs;
+
+  // compressed second tier: clean pages evicted from the pool are
+  // kept compressed in up to tierBytes of memory, besides the pool,
+  // and a miss looks there before reading the page from disk.  0
+  // turns it off.  See CompressedTier.
+  size_t tierBytes;
+
+  BufConfig()
+    {
+      partitions = 16;
+      policy = REPL_CLOCK;
+      bgWriter = false;
+      dirtyHigh = 0.5;
+      dirtyLow = 0.25;
+      writerInterval = 50;
+      writerLookahead = 64;
+      syncOnFlush = false;
+      readAhead = 16;
+      readAheadTrigger = 4;
+      hugePages = false;
+      directIO = false;
+      pageSize = PAGESIZE;
+      manifestInterval = 30000;
+      maxBufs = 0;
+      tierBytes = 0;
+    }
+};
+
+
+class BufMgr : private FrameFilter
 {
+  friend class PageGuard;
 private:
-  unsigned int 	 clockHand;
-  int   	 numBufs;    	// Number of pages in buffer pool
-  BufHashTbl*    hashTable;  	// hash table mapping (File, page) to frame
-  BufDesc*	 bufTable;  	// vector of status info, 1 per page
-  BufStats	 bufStats;	// buffer pool statistics
-
-  const Status allocBuf(int & frame);   // allocate a free frame.  
-  const void releaseBuf(int frame); // return unused frame to end of list
-  void advanceClock()
+  std::atomic<int> numBufs;    	// frames in service: 0 .. numBufs-1
+  std::atomic<int> topFrame;    // no frame from here on holds a page
+  int            maxBufs;       // limit for resize
+  int            pageSize;      // bytes per frame
+  BufOAHashTbl*  hashTable;  	// hash table mapping (File, page) to frame
+  BufPolicy*     policy;        // chooses frames to replace
+  std::mutex     freeLatch;     // protects freeFrames
+  std::vector<int> freeFrames;  // frames holding no page
+  std::atomic<int> numDirty;    // frames with dirty set
+  CompressedTier* tier;         // evicted clean pages, or NULL
+
+  // where a segment's page memory came from
+  enum PoolMemory { POOL_HEAP, POOL_MAPPED, POOL_THP, POOL_HUGETLB };
+  PoolMemory     poolMemory;    // ... for the first segment
+
+  // Frames are kept in segments of 2^segShift frames, each with its
+  // own descriptors and page memory, found through a directory that
+  // is never reallocated, so a page stays where it is for as long as
+  // it is pinned.  Growing the pool fills in directory entries;
+  // shrinking frees the page memory of segments past the new size
+  // once their pages are gone.  Descriptors are kept once made: a
+  // thread that read topFrame before a shrink may still look at them.
+  struct Segment {
+    BufDesc*   desc;     // NULL until the segment is first used
+    char*      pages;    // NULL while the segment is not in use
+    size_t     bytes;    // size of the mapping, if mapped
+    PoolMemory memory;
+  };
+  Segment*       segments;
+  int            maxSegments;
+  int            segShift;
+  int            segMask;       // frames per segment - 1
+  void allocSegment(const int k);
+  void freeSegment(const int k);
+
+  BufDesc* desc(const int frame) const
   {
-	clockHand = (clockHand + 1) % numBufs;
+	return &segments[frame >> segShift].desc[frame & segMask];
   }
 
+  // the page held in frame
+  Page* pageOf(const int frame) const
+  {
+	return (Page*)(segments[frame >> segShift].pages +
+		       (size_t)(frame & segMask) * pageSize);
+  }
 
-public:
-  Page*	         bufPool;   // actual buffer pool
+  // every live buffer manager, for flushFromAll
+  static std::mutex poolsLatch;
+  static std::vector<BufMgr*> pools;
+  // every open file, to preload from pools built after it was opened
+  static std::vector<File*> liveFiles;
+
+  BufConfig      config;
+  std::thread    writer;        // background writer, if configured
+  std::mutex     writerLatch;   // protects writerStop
+  std::condition_variable writerWake;
+  bool           writerStop;
+  std::atomic<int> dirtyHighCount; // numDirty at which the writer is woken
+
+  // allocate a free frame for (file,pageNo); on success the frame is
+  // returned with its latch held and a pin count of one.  With
+  // cleanOnly, dirty pages are not written back to make room.
+  const Status allocBuf(int & frame, const File* file, const int pageNo,
+                        const bool cleanOnly = false);
+  void releaseBuf(int frame); // give back a frame obtained from allocBuf
+  bool dropPage(const File* file, const int pageNo, const bool pinned);
+  bool popFreeFrame(int & frame);
+  void pushFreeFrame(const int frame);
+
+  // FrameFilter: frame holds an unpinned page
+  bool evictable(const int frame) const;
+
+  // pin (file,pageNo) if it is in the pool
+  bool pinCached(const File* file, const int pageNo, int & frameNo);
+
+  // second half of pinCached, once the pin is taken: false if the
+  // frame turned out not to hold the page, with the pin dropped again
+  bool finishPin(const int frameNo);
+
+  // drop a pin on a frame, for PageGuard::release
+  const Status unpinFrame(const int frame, const bool dirty);
+
+  // readPage, allocPage and readPages, giving the frames
+  const Status readFrame(File* file, const int PageNo, int& frameNo);
+  const Status allocFrame(File* file, int& PageNo, int& frameNo);
+  const Status readFrames(File* file, const int firstPageNo, const int count,
+                          int* frameNos, Page** pages);
+
+  // read-ahead and multi-page reads
+  const Status claimRun(File* file, const int first, const int max,
+                        const bool prefetch, std::vector<int>& frames);
+  const Status loadRun(File* file, const int first,
+                       const std::vector<int>& frames, const bool prefetch);
+  void abortLoad(const int frame);
+  void readAhead(File* file, const int pageNo, const bool hit);
+
+  // buffer pool statistics; accesses is the sum of HITS, MISSES and
+  // ALLOCS, so a hit costs one add
+  enum { HITS, MISSES, ALLOCS, DISKREADS, DISKWRITES, FGWRITES, BGWRITES,
+	 PREFETCH_ISSUED, PREFETCH_HITS, PREFETCH_WASTED, EVICTIONS,
+	 DIRTY_EVICTIONS, ALLOCBUF_CALLS, SWEEP_STEPS, BUFFER_EXCEEDED,
+	 PRELOADED, TIER_HITS, TIER_STORES, TIER_REJECTS, TIER_DROPS,
+	 NUM_COUNTERS };
+  StatCounters<NUM_COUNTERS> counters;
+  void readCounters(BufStats& stats, const bool mine) const;
+
+  // count a read-ahead page leaving the pool before it was accessed
+  void retire(BufDesc* buf)
+  {
+	if (buf->prefetched.exchange(false))
+	    counters.add(PREFETCH_WASTED);
+  }
+
+  // clear the dirty bit of a frame, keeping numDirty in step
+  void markClean(BufDesc* buf)
+  {
+	if (buf->dirty.exchange(false))
+	    numDirty--;
+  }
+  void markDirty(BufDesc* buf)
+  {
+	if (!buf->dirty.exchange(true) && ++numDirty == dirtyHighCount)
+	    writerWake.notify_one();
+  }
+
+  void bgWriterLoop();
+  bool cleanFrame(const int frame);  // background write of one frame
+
+  // warm restart: the working set of files whose pages are not in
+  // the pool, as kept when they closed or loaded from the manifest
+  // and not yet read back in
+  struct ManifestEntry {
+    int pageNo;
+    unsigned char heat;   // BufPolicy::hotness when it was taken
+  };
+  typedef std::map<std::string, std::vector<ManifestEntry> > WorkingSet;
+  std::mutex     manifestLatch; // protects known, serializes saves
+  WorkingSet     known;
+  const Status loadManifest();
+  void residentPages(WorkingSet& set, const File* only);
+  void retain(const File* file);
+  void addKnown(WorkingSet& set, const File* only);
+  void forget(const File* file, std::vector<int>& pageNos);
+
+  // preloading from the manifest, by a thread of its own
+  struct PreloadJob {
+    File* file;
+    std::vector<int> pageNos;   // sorted
+  };
+  std::thread    preloader;
+  std::mutex     preloadLatch;  // protects the fields below
+  std::condition_variable preloadWake;
+  std::deque<PreloadJob> preloadQueue;
+  const File*    preloading;    // file being preloaded, or NULL
+  std::atomic<bool> preloadCancel; // stop preloading it
+  bool           preloadStop;
+  void preloaderLoop();
+  void preload(File* file, const std::vector<int>& pageNos);
+  void queuePreload(File* file);
+  void cancelPreload(const File* file);
+
+  // write back the dirty pages among frames in file and page order,
+  // one vectored write per run of consecutive pages
+  const Status writeFrames(std::vector<int>& frames, const bool background = false);
+
+  // shrinking: a thread of its own empties the frames past numBufs
+  std::mutex     resizeLatch;   // serializes resizes; protects the fields below
+  std::condition_variable resizeWake;
+  std::thread    resizer;
+  bool           retiring;      // frames past numBufs may hold pages
+  bool           resizeStop;
+  void resizerLoop();
+  bool retireFrames();
 
-  BufMgr(const int bufs);
+
+public:
+  BufMgr(const int bufs, const BufConfig& config = BufConfig());
   ~BufMgr();
 
   const Status readPage(File* file, const int PageNo, Page*& page);
+  const Status readPages(File* file, const int firstPageNo, const int count,
+                         Page** pages);  // pin count consecutive pages
   const Status unPinPage(File* file, const int PageNo, const bool dirty);
   const Status allocPage(File* file, int& PageNo, Page*& page); 
                         // allocates a new, empty page 
+
+  // the same with the pin held by a guard
+  const Status readPage(File* file, const int PageNo, PageGuard& guard);
+  const Status allocPage(File* file, int& PageNo, PageGuard& guard);
+
+  // Pin pages pageNos[0..count-1] of file into guards[0..count-1].
+  // Cached pages are pinned taking each hash table partition latch
+  // once; the rest are read with one vectored read per run of
+  // consecutive page numbers.  On error no page is left pinned.
+  const Status pinPages(File* file, const int* pageNos, const int count,
+                        PageGuard* guards);
+  // release count guards, of any pools; returns the first error
+  static const Status unpinPages(PageGuard* guards, const int count);
   const Status flushFile(const File* file); // writing out all dirty pages of the file
+  const Status flushAll(); // write back all unpinned dirty pages, keep them cached
+  static const Status flushFromAll(const File* file); // flushFile in every pool
+
+  // warm restart, see BufConfig::manifest
+  const Status saveManifest();         // write the manifest now
+  static void fileOpened(File* file);  // File::open: preload its pages
+  void waitForPreload();               // until no preloading is left to do
   const Status disposePage(File* file, const int PageNo); // dispose of page in file
+
+  // Change the number of frames to bufs, 1 to BufConfig::maxBufs,
+  // without stopping the pool.  Growing takes effect at once.
+  // Shrinking takes the frames from bufs on out of service at once;
+  // their pages are written back and dropped in the background, each
+  // pinned one once it is unpinned, and then their memory is freed.
+  const Status resize(const int bufs);
+  void waitForResize();                // until shrinking is done
+  int getNumBufs() const { return numBufs; }
+
+  const char* poolMemoryName() const; // "heap", "mapped", "thp" or "hugetlb"
+  int getPageSize() const { return pageSize; } // bytes per frame
   void  printSelf();
+  void  printStats(std::ostream & os = std::cout); // pool and per-file statistics
 
-  const BufStats & getBufStats() const // get buffer pool usage
+  const BufStats getBufStats() const; // get buffer pool usage
+  const BufStats getThreadBufStats() const; // ... by the calling thread
+  const TierStats getTierStats() const; // what the compressed tier holds
+  const void clearBufStats() 
   {
-	return bufStats;
+	counters.clear();
   }
-  const void clearBufStats() 
+};
+
+
+// A buffer manager whose frames hold PageT<SIZE> pages, handing them
+// out with that type.  It is a BufMgr with pageSize set to SIZE.
+template <unsigned SIZE>
+class BufMgrT : public BufMgr
+{
+private:
+  static BufConfig sized(BufConfig config)
+  {
+	config.pageSize = SIZE;
+	return config;
+  }
+
+public:
+  typedef PageT<SIZE> PageType;
+
+  BufMgrT(const int bufs, const BufConfig& config = BufConfig())
+    : BufMgr(bufs, sized(config)) {}
+
+  using BufMgr::readPage;
+  using BufMgr::readPages;
+  using BufMgr::allocPage;
+
+  const Status readPage(File* file, const int PageNo, PageType*& page)
+  {
+	return BufMgr::readPage(file, PageNo, (Page*&)page);
+  }
+  const Status readPages(File* file, const int firstPageNo, const int count,
+                         PageType** pages)
+  {
+	return BufMgr::readPages(file, firstPageNo, count, (Page**)pages);
+  }
+  const Status allocPage(File* file, int& PageNo, PageType*& page)
   {
-	bufStats.clear();
+	return BufMgr::allocPage(file, PageNo, (Page*&)page);
   }
 };
 
@@ -0,0 +1,289 @@
+#ifndef BUFPOLICY_H
+#define BUFPOLICY_H
+
+#include <mutex>
+#include <atomic>
+#include <list>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include "db.h"
+
+// replacement policies a BufMgr can be built with
+enum ReplPolicy { REPL_CLOCK, REPL_LRU2, REPL_2Q, REPL_ARC };
+
+// identity of a page, used by policies that remember evicted pages
+struct PageId
+{
+  const File* file;
+  int pageNo;
+
+  bool operator == (const PageId & other) const
+    {
+      return file == other.file && pageNo == other.pageNo;
+    }
+};
+
+struct PageIdHash
+{
+  size_t operator () (const PageId & id) const
+    {
+      return (size_t)id.file * 31 + (size_t)id.pageNo * 0x9E3779B97F4A7C15ULL;
+    }
+};
+
+
+// tells a policy whether a frame can be evicted right now
+class FrameFilter
+{
+public:
+  virtual bool evictable(const int frame) const = 0;
+  virtual ~FrameFilter() {}
+};
+
+
+// Interface between BufMgr and a page replacement policy.  BufMgr
+// calls the hooks below as pages move through the pool; the policy
+// only ever chooses among the frames it has been told about.
+//
+// victim() detaches the frame it returns from the policy's lists.
+// BufMgr then either evicts it (evict) or, if another thread got to
+// the frame first, hands it back (keep).  hit() may be called for a
+// detached frame and is then ignored.
+//
+// All hooks may be called from several threads at once.
+class BufPolicy
+{
+public:
+  virtual ~BufPolicy() {}
+
+  static BufPolicy* create(const ReplPolicy kind, const int numBufs);
+
+  virtual const char* name() const = 0;
+
+  // readPage found the page in frame
+  virtual void hit(const int frame) = 0;
+
+  // readPage or allocPage brought (file,pageNo) into frame
+  virtual void install(const int frame, const File* file, const int pageNo) = 0;
+
+  // (file,pageNo) was read ahead into frame and has not been
+  // referenced yet; a wrong guess should be cheap to evict
+  virtual void prefetch(const int frame, const File* file, const int pageNo)
+    {
+      install(frame, file, pageNo);
+    }
+
+  // unPinPage dropped a pin on frame
+  virtual void unpin(const int frame, const bool dirty) {}
+
+  // the page in frame left the pool other than by eviction
+  // (disposePage, flushFile, failed read)
+  virtual void remove(const int frame) = 0;
+
+  // pick a frame to replace for incoming page (file,pageNo);
+  // returns -1 if no frame is evictable.  steps is increased by the
+  // number of frames looked at on the way.
+  virtual int victim(const FrameFilter& filter, const File* file,
+                     const int pageNo, int& steps) = 0;
+
+  // frame returned by victim() now holds no page; (file,pageNo)
+  // is the page that was evicted from it
+  virtual void evict(const int frame, const File* file, const int pageNo) {}
+
+  // frame returned by victim() could not be evicted after all
+  virtual void keep(const int frame) {}
+
+  // up to max frames in the order victim() would consider them,
+  // without detaching any; used to clean pages ahead of eviction
+  virtual void evictionOrder(std::vector<int>& frames, const int max) = 0;
+
+  // how likely the page in each frame is to be wanted again, from 0
+  // to 255, for saving the working set; heat has an entry per frame.
+  // By default frames are ranked by evictionOrder, and frames not in
+  // it (pinned, detached) count as hottest.
+  virtual void hotness(std::vector<unsigned char>& heat);
+
+  // the pool now has bufs frames in service.  Growing comes before
+  // the new frames are used; after shrinking, frames from bufs on
+  // still hold pages until BufMgr removes them, but need not be
+  // offered as victims.  Per-frame state is never given back.
+  virtual void resize(const int bufs) = 0;
+};
+
+
+// The classic single-bit CLOCK.  Lock free: reference bits are
+// atomic and the hand is advanced with fetch_add.  Growing copies the
+// bits to a larger array; old arrays are kept until the policy goes,
+// since a sweeping thread may still be reading one.
+class ClockPolicy : public BufPolicy
+{
+private:
+  std::atomic<int> numBufs;        // frames swept
+  int capacity;                    // size of refbit
+  std::atomic<std::atomic<bool>*> refbit;  // referenced since hand last passed
+  std::vector<std::atomic<bool>*> retired; // earlier, smaller refbit arrays
+  std::atomic<unsigned int> hand;
+
+public:
+  ClockPolicy(const int bufs);
+  ~ClockPolicy();
+
+  const char* name() const { return "CLOCK"; }
+  void hit(const int frame);
+  void install(const int frame, const File* file, const int pageNo);
+  void prefetch(const int frame, const File* file, const int pageNo);
+  void remove(const int frame);
+  int  victim(const FrameFilter& filter, const File* file, const int pageNo,
+               int& steps);
+  void evictionOrder(std::vector<int>& frames, const int max);
+  void hotness(std::vector<unsigned char>& heat);
+  void resize(const int bufs);
+};
+
+
+// LRU-K with K=2 (O'Neil, O'Neil, Weikum).  Evicts the page whose
+// second most recent reference is oldest; pages referenced only once
+// go first, so a scan cannot push out pages referenced twice.  The
+// last reference time of evicted pages is retained (up to numBufs of
+// them) so a page that comes back soon counts as referenced twice.
+class LRU2Policy : public BufPolicy
+{
+private:
+  typedef unsigned long long Tick;
+  struct Key {
+    Tick hist2, hist1;
+    int frame;
+    bool operator < (const Key & other) const
+      {
+        if (hist2 != other.hist2) return hist2 < other.hist2;
+        if (hist1 != other.hist1) return hist1 < other.hist1;
+        return frame < other.frame;
+      }
+  };
+
+  std::mutex latch;
+  int numBufs;
+  int capacity;                // size of the per-frame arrays
+  Tick tick;                   // logical time, one per reference
+  Tick* hist1;                 // time of last reference, per frame
+  Tick* hist2;                 // time of reference before that
+  bool* queued;                // frame is in order
+  bool* unref;                 // read ahead, not referenced yet
+  std::set<Key> order;         // resident frames, eviction order
+  struct Retained {
+    Tick hist1;                        // last reference before eviction
+    std::list<PageId>::iterator pos;   // position in retainedFifo
+  };
+  std::unordered_map<PageId, Retained, PageIdHash> retained;
+  std::list<PageId> retainedFifo;      // front is newest
+
+  Key key(const int frame) const;
+
+public:
+  LRU2Policy(const int bufs);
+  ~LRU2Policy();
+
+  const char* name() const { return "LRU-2"; }
+  void hit(const int frame);
+  void install(const int frame, const File* file, const int pageNo);
+  void prefetch(const int frame, const File* file, const int pageNo);
+  void remove(const int frame);
+  int  victim(const FrameFilter& filter, const File* file, const int pageNo,
+               int& steps);
+  void evict(const int frame, const File* file, const int pageNo);
+  void keep(const int frame);
+  void evictionOrder(std::vector<int>& frames, const int max);
+  void resize(const int bufs);
+};
+
+
+// Full 2Q (Johnson, Shasha).  New pages enter the FIFO A1in; pages
+// evicted from A1in are remembered in the ghost queue A1out, and
+// only a page referenced again while in A1out is promoted to the
+// LRU queue Am.  Kin and Kout are 25% and 50% of the pool.
+class TwoQPolicy : public BufPolicy
+{
+private:
+  enum Queue { NONE, A1IN, AM };
+
+  std::mutex latch;
+  int numBufs;
+  int capacity;                        // size of the per-frame arrays
+  int kin, kout;
+  std::list<int> a1in;                 // front is newest
+  std::list<int> am;                   // front is most recently used
+  std::list<PageId> a1out;             // front is newest
+  std::unordered_map<PageId, std::list<PageId>::iterator, PageIdHash> ghosts;
+  Queue* where;                        // queue each frame is on
+  Queue* detachedFrom;                 // queue victim() took it from
+  std::list<int>::iterator* pos;       // position on that queue
+
+  void detach(const int frame);
+  void attach(const int frame, const Queue queue);
+  int  scan(std::list<int>& queue, const FrameFilter& filter, int& steps);
+
+public:
+  TwoQPolicy(const int bufs);
+  ~TwoQPolicy();
+
+  const char* name() const { return "2Q"; }
+  void hit(const int frame);
+  void install(const int frame, const File* file, const int pageNo);
+  void prefetch(const int frame, const File* file, const int pageNo);
+  void remove(const int frame);
+  int  victim(const FrameFilter& filter, const File* file, const int pageNo,
+               int& steps);
+  void evict(const int frame, const File* file, const int pageNo);
+  void keep(const int frame);
+  void evictionOrder(std::vector<int>& frames, const int max);
+  void resize(const int bufs);
+};
+
+
+// ARC (Megiddo, Modha).  T1 holds pages seen once recently, T2 pages
+// seen at least twice; ghost lists B1 and B2 remember what was evicted
+// from each, and hits on them move the target size p of T1.
+class ARCPolicy : public BufPolicy
+{
+private:
+  enum List { NONE, T1, T2 };
+  typedef std::list<PageId> GhostList;
+  typedef std::unordered_map<PageId, GhostList::iterator, PageIdHash> GhostMap;
+
+  std::mutex latch;
+  int numBufs;
+  int capacity;                        // size of the per-frame arrays
+  int p;                               // target size of T1
+  std::list<int> t1, t2;               // front is most recently used
+  GhostList b1, b2;
+  GhostMap inB1, inB2;
+  List* where;
+  List* detachedFrom;
+  std::list<int>::iterator* pos;
+  bool* unref;                         // read ahead, not referenced yet
+
+  std::list<int>& list(const List which) { return which == T1 ? t1 : t2; }
+  void detach(const int frame);
+  void attach(const int frame, const List which);
+  int  scan(std::list<int>& queue, const FrameFilter& filter, int& steps);
+  void trimGhosts();
+
+public:
+  ARCPolicy(const int bufs);
+  ~ARCPolicy();
+
+  const char* name() const { return "ARC"; }
+  void hit(const int frame);
+  void install(const int frame, const File* file, const int pageNo);
+  void prefetch(const int frame, const File* file, const int pageNo);
+  void remove(const int frame);
+  int  victim(const FrameFilter& filter, const File* file, const int pageNo,
+               int& steps);
+  void evict(const int frame, const File* file, const int pageNo);
+  void keep(const int frame);
+  void evictionOrder(std::vector<int>& frames, const int max);
+  void resize(const int bufs);
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef BUFTIER_H
+#define BUFTIER_H
+
+#include <mutex>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include "db.h"
+#include "bufPolicy.h"
+
+// LZ77 codec in the LZ4 block format: a run of literals, then a match
+// of at least 4 bytes at an offset of up to 65535 back, repeated; the
+// block ends with literals only.  Fast rather than tight, which suits
+// slotted pages whose free space is a long run of one byte.
+
+// Compress srcLen bytes into dst.  Returns the compressed length, or
+// 0 if it would take more than dstCap bytes.
+int lzCompress(const char* src, const int srcLen, char* dst, const int dstCap);
+
+// Decompress srcLen bytes into dst.  Returns the decompressed length,
+// or -1 if src is malformed or would not fit in dstCap bytes.
+int lzDecompress(const char* src, const int srcLen, char* dst, const int dstCap);
+
+
+// How much a CompressedTier holds, as returned by BufMgr::getTierStats.
+struct TierStats
+{
+  int    pages;        // pages held
+  size_t bytes;        // memory they take, bookkeeping included
+  size_t budget;       // the most bytes it may take
+  size_t rawBytes;     // what the pages would take uncompressed
+
+  TierStats() : pages(0), bytes(0), budget(0), rawBytes(0) {}
+};
+
+
+// Second-tier cache of clean pages evicted from a buffer pool, kept
+// compressed in memory within a budget of its own and replaced in
+// LRU order.  A page leaves the tier when it is read back into the
+// pool, so the tier never holds a page the pool holds and never a
+// copy older than the one on disk.
+class CompressedTier
+{
+private:
+  struct Entry {
+    std::vector<char> data;               // compressed page
+    std::list<PageId>::iterator pos;      // position in lru
+  };
+
+  std::mutex latch;                       // protects everything below
+  std::unordered_map<PageId, Entry, PageIdHash> entries;
+  std::list<PageId> lru;                  // front is most recently stored
+  size_t budget;
+  size_t bytes;
+  int pageSize;
+
+  size_t cost(const Entry& entry) const;
+  void erase(std::unordered_map<PageId, Entry, PageIdHash>::iterator it);
+
+public:
+  CompressedTier(const size_t budget, const int pageSize);
+
+  // Compress page into a buffer of the calling thread's, pointed to
+  // by buf until its next pack.  Returns the compressed length, or 0
+  // if the page does not come down to 7/8 of its size and is not
+  // worth keeping.
+  int pack(const void* page, const char*& buf) const;
+
+  // keep length bytes from pack as (file,pageNo), replacing any older
+  // copy; returns the number of pages dropped to make room
+  int put(const File* file, const int pageNo, const char* buf, const int length);
+
+  // Decompress (file,pageNo) into page and drop it from the tier.
+  // False if it is not held.
+  bool take(const File* file, const int pageNo, void* page);
+
+  void drop(const File* file, const int pageNo);
+  void dropFile(const File* file);   // every page of file
+  void getStats(TierStats& stats);
+};
+
+#endif
@@ -2,8 +2,13 @@
 #define DB_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <functional>
+#include <mutex>
+#include <atomic>
+#include <vector>
 #include "error.h"
+#include "stats.h"
 #include <string.h>
 using namespace std;
 
@@ -15,20 +20,81 @@ using namespace std;
 // forward class definition for db
 class DB;
 
-// class definition for open files
+// structure of DB (header) page
+
+typedef struct {
+  int nextFree;                         // page # of next page on free list
+  int firstPage;                        // page # of first page in file
+  int numPages;                         // total # of pages in file
+  int pageSize;                         // bytes per page (0: PAGESIZE)
+} DBPage;
+
+// what has happened to one file, see File::getStats
+struct FileStats
+{
+  unsigned long long hits;           // buffer pool accesses that found the page
+  unsigned long long misses;         // ... that had to read it from the file
+  unsigned long long evictions;      // pages of the file replaced in the pool
+  unsigned long long dirtyEvictions; // ... that had to be written back first
+  unsigned long long pagesRead;      // pages read, read-ahead included
+  unsigned long long pagesWritten;   // pages written
+  LatencyStats reads;                // read system calls
+  LatencyStats writes;               // write system calls
+
+  FileStats operator - (const FileStats & before) const;
+};
+
+// class definition for open files.  A file's page size is chosen
+// when it is created.  Pages are read and written as PageT<size>
+// (see page.h) of that size, or through a Page pointer with the
+// length of the buffer behind it; a size that is not the file's
+// gives BADPAGESIZE.
 class File {
   friend class DB;
   friend class OpenFileHashTbl;
+  friend class BufMgr;
 
  public:
 
   Status allocatePage(int& pageNo);     // allocate a new page
   const Status disposePage(const int pageNo);       // release space for a page
   const Status readPage(const int pageNo,
-		  Page* pagePtr) const;       // read page from file
+		  Page* pagePtr, const int length) const;  // read page from file
+  const Status readPages(const int pageNo, const int count,
+		  Page* const* pages, const int length,
+		  int& nread) const;          // read up to count consecutive pages
   const Status writePage(const int pageNo,
-		   const Page* pagePtr);      // write page to file
+		   const Page* pagePtr, const int length);  // write page to file
+  const Status writePages(const int pageNo, const int count,
+		   const Page* const* pages,
+		   const int length);         // write count consecutive pages
+
+  template <unsigned SIZE>
+  const Status readPage(const int pageNo, PageT<SIZE>* pagePtr) const
+    { return readPage(pageNo, (Page*)pagePtr, SIZE); }
+  template <unsigned SIZE>
+  const Status readPages(const int pageNo, const int count,
+		  PageT<SIZE>* const* pages, int& nread) const
+    { return readPages(pageNo, count, (Page* const*)pages, SIZE, nread); }
+  template <unsigned SIZE>
+  const Status writePage(const int pageNo, const PageT<SIZE>* pagePtr)
+    { return writePage(pageNo, (const Page*)pagePtr, SIZE); }
+  template <unsigned SIZE>
+  const Status writePages(const int pageNo, const int count,
+		   const PageT<SIZE>* const* pages)
+    { return writePages(pageNo, count, (const Page* const*)pages, SIZE); }
+  const Status sync();                      // force written pages to disk
   const Status getFirstPage(int& pageNo) const;     // returns pageNo of first page
+  const Status getPageCount(int& count) const;      // pages in file, header included
+  const Status getPageSize(int& size) const;        // bytes per page
+  const Status flushHeader();               // write header and free list now
+  const Status getStats(FileStats& stats) const;    // counters since the file was opened
+
+  // write the header after this many allocations and disposals
+  // (0: only when the file is closed or flushHeader is called)
+  static void setCheckpointInterval(const int changes);
+
+  bool isDirect() const { return direct; }  // this file uses O_DIRECT
 
   bool operator == (const File & other) const
     {
@@ -40,16 +106,35 @@ class File {
   File(const string &fname);                   // initialize
   ~File();                  // deallocate file object
 
-  static const Status create(const string &fileName);
+  static const Status create(const string &fileName, const int pageSize);
   static const Status destroy(const string &fileName);
 
-  const Status open();
+  const Status open(const bool directIO);
   const Status close();
 
   const Status intread(const int pageNo,
 		 Page* pagePtr) const;        // internal file read
   const Status intwrite(const int pageNo,
 		  const Page* pagePtr);       // internal file write
+  const Status intwritev(const int pageNo, const int count,
+		  const Page* const* pages);  // internal vectored write
+  const Status intreadv(const int pageNo, const int count,
+		  Page* const* pages,
+		  int& nread) const;          // internal vectored read
+  ssize_t transfer(const bool write, const int pageNo,
+		   const struct iovec* iov, const int n) const;
+  bool dropDirect() const;              // fall back to buffered I/O
+
+  const Status loadHeader();            // read header, build free bitmap
+  const Status persistHeader();         // write header, free list changes
+  const Status noteChange();            // count a change, checkpoint
+  const Status unlinkFree(const int pageNo); // take a page off the chain on disk
+  const Status extend(const int pages); // make room for pages on disk
+  bool isFree(const int pageNo) const
+    {
+      return (freeMap[pageNo >> 6] >> (pageNo & 63)) & 1;
+    }
+  int firstFree(const int first, const int end) const; // for BufMgr, takes hdrLatch
 
 #ifdef DEBUGFREE
   void listFree();                      // list free pages
@@ -58,6 +143,36 @@ class File {
   string fileName;                    // The name of the file
   int openCnt;                        // # times file has been opened
   int unixFile;                       // unix file stream for file
+  mutable std::atomic<bool> direct;   // unixFile has O_DIRECT set
+  int dioAlign;                       // memory alignment O_DIRECT needs
+  int pageSize;                       // bytes per page, from the header
+  mutable std::mutex hdrLatch;        // protects the fields below
+
+  // The header and the free list live in memory while the file is
+  // open and are written back lazily; see persistHeader.
+  DBPage hdr;                         // header page contents
+  std::atomic<int> numPages;          // hdr.numPages, read without the latch
+  std::vector<unsigned long long> freeMap;  // bit set for each free page
+  std::vector<unsigned long long> diskFree; // free pages as last written
+  int diskPages;                      // hdr.numPages as last written
+  int freeCount;                      // pages set in freeMap
+  int freeHint;                       // no free page in words below this
+  int extentEnd;                      // pages the file has room for on disk
+  int hdrChanges;                     // changes since the header was written
+  static int checkpointInterval;
+
+  // sequential read detection, kept by the buffer manager
+  std::atomic<int> seqNext;           // page that would extend the run
+  std::atomic<int> seqRun;            // pages read in sequence so far
+  std::atomic<int> raEnd;             // end of the last read-ahead window
+
+  // statistics; hits, misses and evictions are counted by the buffer
+  // manager, the rest by the I/O routines
+  enum { HITS, MISSES, EVICTIONS, DIRTY_EVICTIONS, PAGES_READ,
+         PAGES_WRITTEN, NUM_COUNTERS };
+  mutable StatCounters<NUM_COUNTERS> counters;
+  mutable LatencyHistogram readLatency;
+  LatencyHistogram writeLatency;
 };
 
 class BufMgr;
@@ -103,10 +218,16 @@ class DB {
   DB();                                 // initialize open file table
   ~DB();                                // clean up any remaining open files
 
-  const Status createFile(const string & fileName) ;  // create a new file
+  const Status createFile(const string & fileName,
+                          const int pageSize = PAGESIZE);  // create a new file
   const Status destroyFile(const string & fileName) ; // destroy a file, 
                                                            // release all space
-  const Status openFile(const string & fileName, File* & file);  // open a file
+  // Open a file.  directIO: use O_DIRECT, bypassing the kernel's page
+  // cache, where the file system allows it (see File::isDirect).  It
+  // takes effect when the file is first opened; opening a file that
+  // is open already leaves it as it is.
+  const Status openFile(const string & fileName, File* & file,
+                        const bool directIO = false);
   const Status closeFile(File* file);         // close a file
 
  private:
@@ -114,12 +235,4 @@ class DB {
 };
 
 
-// structure of DB (header) page
-
-typedef struct {
-  int nextFree;                         // page # of next page on free list
-  int firstPage;                        // page # of first page in file
-  int numPages;                         // total # of pages in file
-} DBPage;
-
 #endif
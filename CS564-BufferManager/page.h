@@ -3,6 +3,7 @@
 
 #include "error.h"
 #include "string.h"
+#include <stddef.h>
 
 struct RID{
     int  pageNo;
@@ -23,21 +24,68 @@ struct slot_t {
         short	length;  // equals -1 if slot is not in use
 };
 
-const unsigned PAGESIZE = 1024;
+const unsigned PAGESIZE = 1024;     // default page size, and the smallest
+const unsigned MAXPAGESIZE = 16384; // largest page size
 const unsigned DPFIXED= sizeof(slot_t)+4*sizeof(short)+2*sizeof(int);
 const unsigned PAGEDATASIZE = PAGESIZE-DPFIXED+sizeof(slot_t);
 // size of the data area of a page
 
-// Class definition for a minirel data page.   
+// a live record, as returned by PageT::scanSlots and scanRecords:
+// its slot number (RID::slotNo) and where it is in the data area
+struct SlotEntry {
+        int     slotNo;
+        short   offset;
+        short   length;
+};
+
+// A test on the int stored fieldOffset bytes into each record, for
+// PageT::scanRecords: the field compared with value by op, or, if
+// test is given, test(field, arg).  Records too short to hold the
+// field never match.
+struct FieldPredicate {
+        enum Op { EQ, NE, LT, LE, GT, GE };
+
+        int     fieldOffset;
+        Op      op;
+        int     value;
+        bool    (*test)(const int field, void* arg);
+        void*   arg;
+
+        FieldPredicate(const int fieldOffset, const Op op, const int value)
+          : fieldOffset(fieldOffset), op(op), value(value), test(NULL), arg(NULL) {}
+        FieldPredicate(const int fieldOffset,
+                       bool (*test)(const int field, void* arg), void* arg)
+          : fieldOffset(fieldOffset), op(EQ), value(0), test(test), arg(arg) {}
+};
+
+// Kernels the bulk scans and deleteRecord's compaction run on.  The
+// best one the CPU supports is used unless another is set; setting
+// one the CPU lacks gets the best it has.  For tests and benchmarks.
+enum ScanKernel { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+ScanKernel setScanKernel(const ScanKernel kernel);  // returns the one now used
+ScanKernel getScanKernel();
+const char* scanKernelName(const ScanKernel kernel);
+
+// page sizes files and buffer pools can use: powers of two from
+// PAGESIZE to MAXPAGESIZE
+inline bool validPageSize(const int size)
+{
+    return size >= (int)PAGESIZE && size <= (int)MAXPAGESIZE &&
+           (size & (size - 1)) == 0;
+}
+
+// Class definition for a minirel data page of SIZE bytes.
 // The design assumes that records are kept compacted when
 // deletions are performed. Notice, however, that the slot
 // array cannot be compacted.  Notice, this class does not keep
 // the records align, relying instead on upper levels to take
 // care of non-aligned attributes
+// The code is instantiated in page.C for each valid page size.
 
-class Page {
+template <unsigned SIZE>
+class PageT {
 private:
-    char 	data[PAGESIZE - DPFIXED]; 
+    char 	data[SIZE - DPFIXED]; 
     slot_t 	slot[1]; // first element of slot array - grows backwards!
     short	slotCnt; // number of slots in use;
     short	freePtr; // offset of first free byte in data[]
@@ -46,7 +94,21 @@ private:
     int		nextPage; // forwards pointer
     int		curPage;  // page number of current pointer
 
+    // Slot i, for i from slotCnt+1 to 0: the slot array grows down
+    // over the end of data[].  Indexing slot[] itself past its one
+    // element is undefined, and g++ -O2 miscompiles the slot loops
+    // if it is done.
+    slot_t& slotAt(const int i)
+      { return ((slot_t*)((char*)this + offsetof(PageT, slot)))[i]; }
+    const slot_t& slotAt(const int i) const
+      { return ((const slot_t*)((const char*)this + offsetof(PageT, slot)))[i]; }
+
 public:
+    static const unsigned DATASIZE = SIZE - DPFIXED + sizeof(slot_t);
+                                 // size of the data area
+    static const unsigned MAXSLOTS = DATASIZE / sizeof(slot_t);
+                                 // most slots a page can have
+
     void init(const int pageNo); // initialize a new page
     void dumpPage() const;       // dump contents of a page
 
@@ -70,6 +132,21 @@ public:
 
     // returns reference to record with RID rid
     const Status getRecord(const RID & rid, Record & rec);
+
+    // Bulk scans: the live records in slot order, as firstRecord and
+    // nextRecord visit them, written to out, which must have room for
+    // slotCount() entries; return how many there are.  The slot
+    // directory is filtered with SIMD instructions where the CPU has
+    // them, see ScanKernel.  scanRecords keeps those that satisfy pred.
+    int scanSlots(SlotEntry* out) const;
+    int scanRecords(const FieldPredicate& pred, SlotEntry* out) const;
+    int slotCount() const { return -slotCnt; }   // slots in use or free
+    const char* recordData(const SlotEntry& entry) const { return &data[entry.offset]; }
 };
 
+typedef PageT<PAGESIZE> Page;       // the default page
+typedef PageT<4096>     Page4K;
+typedef PageT<8192>     Page8K;
+typedef PageT<16384>    Page16K;
+
 #endif
@@ -0,0 +1,132 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+// Counters and latency histograms kept by the buffer manager and by
+// open files.  They are always on, so the costs are kept down to
+// what an uncontended atomic add costs.
+
+const int STAT_SHARDS = 16;
+
+// Shard the calling thread counts into.  Threads are dealt out round
+// robin as they first count something, so up to STAT_SHARDS threads
+// each have a shard to themselves.
+inline int statShard()
+{
+  static std::atomic<int> next(0);
+  static thread_local int shard = -1;
+  if (shard < 0)
+    shard = next++ % STAT_SHARDS;
+  return shard;
+}
+
+// N 64-bit event counters.  Every shard holds all N on cache lines
+// of its own, so threads bumping the same counter do not bounce a
+// line between them.  sum() adds up the shards; it is exact once the
+// threads counting have stopped.
+template <int N>
+class StatCounters
+{
+private:
+  struct alignas(64) Shard {
+    std::atomic<unsigned long long> c[N];
+  };
+  Shard shards[STAT_SHARDS];
+
+public:
+  StatCounters() { clear(); }
+
+  void add(const int k, const unsigned long long n = 1)
+    {
+      shards[statShard()].c[k].fetch_add(n, std::memory_order_relaxed);
+    }
+
+  unsigned long long sum(const int k) const
+    {
+      unsigned long long n = 0;
+      for (int i = 0; i < STAT_SHARDS; i++)
+        n += shards[i].c[k].load(std::memory_order_relaxed);
+      return n;
+    }
+
+  // the calling thread's shard alone: its own counts, if no other
+  // live thread shares the shard
+  unsigned long long mine(const int k) const
+    {
+      return shards[statShard()].c[k].load(std::memory_order_relaxed);
+    }
+
+  void clear()
+    {
+      for (int i = 0; i < STAT_SHARDS; i++)
+        for (int k = 0; k < N; k++)
+          shards[i].c[k].store(0, std::memory_order_relaxed);
+    }
+};
+
+
+// Contents of a LatencyHistogram at some point.  Bucket i counts
+// calls that took from 2^i up to 2^(i+1) ns (bucket 0 also takes
+// 0 ns); the last bucket takes everything longer.
+struct LatencyStats
+{
+  static const int BUCKETS = 40;     // 2^40 ns is about 18 minutes
+
+  unsigned long long count;          // calls recorded
+  unsigned long long totalNs;        // time they took together
+  unsigned long long bucket[BUCKETS];
+
+  LatencyStats() { clear(); }
+  void clear();
+
+  double meanNs() const;
+
+  // upper bound of the bucket holding the p-th fraction of the calls
+  // (0 < p <= 1), or 0 if there were none
+  unsigned long long percentileNs(const double p) const;
+
+  LatencyStats operator - (const LatencyStats & before) const;
+  LatencyStats & operator += (const LatencyStats & other);
+
+  // one line: count, mean, p50, p99, p99.9, max
+  void print(std::ostream & os) const;
+};
+
+
+// Log bucketed histogram of call latencies.  record() costs two
+// relaxed atomic adds; histograms sit on I/O paths, where that is
+// nothing next to the system call.
+class LatencyHistogram
+{
+private:
+  std::atomic<unsigned long long> bucket[LatencyStats::BUCKETS];
+  std::atomic<unsigned long long> totalNs;
+
+public:
+  LatencyHistogram() { clear(); }
+
+  void record(const unsigned long long ns)
+    {
+      int b = ns < 2 ? 0 : 63 - __builtin_clzll(ns);
+      if (b >= LatencyStats::BUCKETS)
+        b = LatencyStats::BUCKETS - 1;
+      bucket[b].fetch_add(1, std::memory_order_relaxed);
+      totalNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+  void read(LatencyStats & stats) const;
+  void clear();
+};
+
+
+// monotonic time in ns, for timing calls
+inline unsigned long long statClock()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif